@@ -12,12 +12,15 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Juan Alberto Pablos");
 MODULE_DESCRIPTION("Sistema de ficheros ASSOOFS");
 // Prototipos de nuevas funciones
-static uint64_t assoofs_sb_get_freeinode(struct super_block *sb);
+static int assoofs_sb_get_freeinode(struct super_block *sb, uint64_t *inode_no);
 static int assoofs_remove(struct inode *dir, struct dentry *dentry);
-static void assoofs_add_inode_info(struct super_block *sb, struct assoofs_inode_info *inode);
+static int assoofs_add_inode_info(struct super_block *sb, struct inode *inode, struct assoofs_inode_info *inode_info);
 static void assoofs_save_sb_info(struct super_block *sb);
-static uint64_t assoofs_sb_get_freeblock(struct super_block *sb);
-static struct assoofs_inode_info *assoofs_get_inode_info(struct super_block *sb, uint64_t inode_no);
+static uint64_t assoofs_sb_get_freeblock(struct super_block *sb, uint64_t inode_no);
+static struct assoofs_inode_info *assoofs_get_inode_info(struct super_block *sb, struct inode *inode, uint64_t inode_no);
+static struct assoofs_dir_record_v2 *assoofs_dir_record_v2_at(struct buffer_head *bh, size_t offset);
+static int assoofs_add_dir_record(struct super_block *sb, struct assoofs_inode_info *dir_info, const char *name, uint64_t inode_no);
+static int assoofs_find_dir_record(struct super_block *sb, struct assoofs_inode_info *dir_info, const char *name, uint64_t *inode_no, bool mark_removed);
 static ssize_t assoofs_write(struct file *filp, const char __user *buf, size_t len, loff_t *ppos);
 static ssize_t assoofs_read(struct file *filp, char __user *buf, size_t len, loff_t *ppos);
 static int assoofs_create(struct mnt_idmap *idmap, struct inode *dir, struct dentry *dentry, umode_t mode, bool excl);
@@ -26,6 +29,21 @@ struct dentry *assoofs_lookup(struct inode *parent_inode, struct dentry *child_d
 static int assoofs_iterate(struct file *filp, struct dir_context *ctx);
 
 
+static inline bool assoofs_is_v2(struct super_block *sb) { //la version se lee del superbloque al montar
+    struct assoofs_super_block_info *assoofs_sb = sb->s_fs_info;
+    return assoofs_sb->version == ASSOOFS_VERSION_V2;
+}
+
+static inline size_t assoofs_inode_size(struct super_block *sb) { //tamaño de cada inodo en el bloque de inodos
+    return assoofs_is_v2(sb) ? sizeof(struct assoofs_inode_v2) : sizeof(struct assoofs_inode_info);
+}
+
+static void assoofs_drop_new_inode(struct inode *inode) { //deshace un inodo recien creado que no se ha llegado a enlazar
+    kfree(inode->i_private);
+    inode->i_private = NULL;
+    iput(inode);
+}
+
 // Operaciones sobre directorios
 const struct file_operations assoofs_dir_operations = {
     .owner = THIS_MODULE,
@@ -58,8 +76,14 @@ static struct file_system_type assoofs_type = {
 };
 
 // Operaciones sobre superbloque
+static void assoofs_put_super(struct super_block *sb) { //libera la copia en memoria del superbloque
+    kfree(sb->s_fs_info);
+    sb->s_fs_info = NULL;
+}
+
 static const struct super_operations assoofs_sops = {
     .drop_inode = generic_delete_inode,
+    .put_super = assoofs_put_super,
 };
 
 // Función para inicializar el superbloque
@@ -70,17 +94,44 @@ int assoofs_fill_super(struct super_block *sb, void *data, int silent) { //punte
     struct assoofs_super_block_info *assoofs_sb;
 //bh sera el buffer head con los datos leidos
     bh = sb_bread(sb, ASSOOFS_SUPERBLOCK_BLOCK_NUMBER);  //lee el bloque 0 donde esta el sb y nos pasa el buffer_head con los datos leidos
-    assoofs_sb = (struct assoofs_super_block_info *)bh->b_data; //interpretamos los bytres leidos como una struct de sb
+    struct assoofs_super_block_v2 *disk_sb = (struct assoofs_super_block_v2 *)bh->b_data; //el bloque visto como v2 (little-endian) para mirar la version
+
+    if (le64_to_cpu(disk_sb->version) == ASSOOFS_VERSION_V2) { //v2 guarda el superbloque en little-endian, en memoria lo tenemos en el orden de la CPU
+        assoofs_sb = kzalloc(sizeof(struct assoofs_super_block_info), GFP_KERNEL);
+        if (!assoofs_sb) {
+            brelse(bh);
+            return -ENOMEM;
+        }
+        assoofs_sb->version = le64_to_cpu(disk_sb->version);
+        assoofs_sb->magic = le64_to_cpu(disk_sb->magic);
+        assoofs_sb->block_size = le64_to_cpu(disk_sb->block_size);
+        assoofs_sb->inodes_count = le64_to_cpu(disk_sb->inodes_count);
+        assoofs_sb->free_blocks = le64_to_cpu(disk_sb->free_blocks);
+        assoofs_sb->free_inodes = le64_to_cpu(disk_sb->free_inodes);
+    } else {
+        assoofs_sb = kmemdup(bh->b_data, sizeof(struct assoofs_super_block_info), GFP_KERNEL); //copia propia, el buffer se libera justo despues
+        if (!assoofs_sb) {
+            brelse(bh);
+            return -ENOMEM;
+        }
+    }
+    brelse(bh);  //ya tenemos la copia en memoria
 
     if (assoofs_sb->magic != ASSOOFS_MAGIC) {  //comprobamos que lo que sacamos del bloque 0 de tipo sb sea assoofs
         printk(KERN_ERR "Invalid magic number: %llu\n", assoofs_sb->magic);
-        brelse(bh); //libera el buffer head
+        kfree(assoofs_sb);
+        return -EINVAL;
+    }
+    if (assoofs_sb->version != ASSOOFS_VERSION_V1 && assoofs_sb->version != ASSOOFS_VERSION_V2) {  //solo sabemos leer v1 y v2
+        printk(KERN_ERR "Unsupported assoofs version: %llu\n", assoofs_sb->version);
+        kfree(assoofs_sb);
         return -EINVAL;
     }
 
     sb->s_magic = assoofs_sb->magic;   
     sb->s_fs_info = assoofs_sb; //Guarda un puntero a nuestra copia en memoria del superbloque ASSOOFS 
     sb->s_op = &assoofs_sops; //le asigna las operaciones de sb que hay arriba
+    printk(KERN_INFO "assoofs on-disk format version %llu\n", assoofs_sb->version);
     struct inode *root_inode = new_inode(sb); //crea un nuevo inodo que sera el del directorio raiz
     inode_init_owner(&nop_mnt_idmap, root_inode, NULL, S_IFDIR);  //Inicializa como directorio (S_IFDIR) y establece propietario (root / idmap nulo)
     root_inode->i_ino = ASSOOFS_ROOTDIR_INODE_NUMBER; 
@@ -88,19 +139,16 @@ int assoofs_fill_super(struct super_block *sb, void *data, int silent) { //punte
     root_inode->i_op = &assoofs_inode_ops;  //le pasamos las operaciones que podra hacer, estan en un struct arriba
     root_inode->i_fop = &assoofs_dir_operations; //esto porque sera un directorio asique sus operaciones son estas
 
-    root_inode->i_private = kzalloc(sizeof(struct assoofs_inode_info), GFP_KERNEL); //reserva memoria para guardar informacion extendida
-    struct buffer_head *inode_bh;
-    struct assoofs_inode_info *root_inode_info;
-
-    inode_bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER); //leemos el bloque donde estan los inodos el 1
-    root_inode_info = (struct assoofs_inode_info *)inode_bh->b_data;  //interpreta los datos como inodo
-    memcpy(root_inode->i_private, root_inode_info, sizeof(struct assoofs_inode_info)); //copia la informacion al nodo i_private del inodo raiz
-    brelse(inode_bh); //libera el buffer de lectura anterior
+    root_inode->i_private = assoofs_get_inode_info(sb, root_inode, ASSOOFS_ROOTDIR_INODE_NUMBER); //lee el inodo raiz del almacen de inodos (bloque 1) sea v1 o v2
+    if (!root_inode->i_private) {
+        iput(root_inode);
+        sb->s_fs_info = NULL; //sin s_root no se llama a put_super, liberamos aqui
+        kfree(assoofs_sb);
+        return -EIO;
+    }
 
     sb->s_root = d_make_root(root_inode); //marca este inodo como la raiz del sistema IMPORTANTE
 
-    brelse(bh);  //libera el buffer
-
     printk(KERN_INFO "Superblock initialized successfully\n");
     return 0;
 }
@@ -129,6 +177,8 @@ static int assoofs_iterate(struct file *filp, struct dir_context *ctx) { //filp
     struct assoofs_inode_info *inode_info = inode->i_private; //obtenemos la estrucutra privada (cuantos hijos tiene y donde estan sus entradas en el directorio disco)
     struct buffer_head *bh; //variables para leer entradas
     struct assoofs_dir_record_entry *record;
+    struct assoofs_dir_record_v2 *record_v2;
+    size_t offset = 0;
     int i; //i :)
 
     printk(KERN_INFO "assoofs_iterate called\n");  //log util 
@@ -137,6 +187,25 @@ static int assoofs_iterate(struct file *filp, struct dir_context *ctx) { //filp
         return 0;
 
     bh = sb_bread(sb, inode_info->data_block_number);  //leemos el bloque de datos con las entradas de directorio 
+    if (!bh)
+        return -EIO;
+
+    if (assoofs_is_v2(sb)) {  //en v2 las entradas son de longitud variable, se salta con rec_len
+        for (i = 0; i < inode_info->dir_children_count; i++) {
+            record_v2 = assoofs_dir_record_v2_at(bh, offset);
+            if (!record_v2)
+                break;
+            if (!(record_v2->flags & ASSOOFS_DIRENT_V2_REMOVED)) {
+                dir_emit(ctx, record_v2->name, record_v2->name_len,
+                         le64_to_cpu(record_v2->inode_no), DT_UNKNOWN);
+                ctx->pos += le16_to_cpu(record_v2->rec_len);
+            }
+            offset += le16_to_cpu(record_v2->rec_len);
+        }
+        brelse(bh);
+        return 0;
+    }
+
     record = (struct assoofs_dir_record_entry *)bh->b_data; //su estructura es esa 
 
     for (i = 0; i < inode_info->dir_children_count; i++) {  //se recorre cada hijo del directorio 
@@ -158,8 +227,8 @@ static int assoofs_create(struct mnt_idmap *idmap, struct inode *dir, struct den
     struct assoofs_inode_info *parent_info = dir->i_private; // Y aqui los metadatos del dirctorio padre
     struct inode *inode;
     struct assoofs_inode_info *inode_info;
-    struct buffer_head *bh;
-    struct assoofs_dir_record_entry *record;
+    uint64_t inode_no;
+    int ret;
 
     printk(KERN_INFO "assoofs_create called\n");
 
@@ -168,40 +237,58 @@ static int assoofs_create(struct mnt_idmap *idmap, struct inode *dir, struct den
         return -ENOSPC;
     }
 
+    ret = assoofs_sb_get_freeinode(sb, &inode_no);   // uso la funcion de mas abajo para darle un numero libre, antes de tocar el padre
+    if (ret)
+        return ret;
+
     inode = new_inode(sb);  //creamos un inodo nuebo
-    inode->i_ino = assoofs_sb_get_freeinode(sb);   // uso la funcion de mas abajo para darle un numero libre
+    if (!inode)
+        return -ENOMEM;
+    inode->i_ino = inode_no;
     inode->i_sb = sb;
     inode_init_owner(&nop_mnt_idmap, inode, dir, S_IFREG | mode); //se inicializa como fichero regular
+    simple_inode_init_ts(inode); //fechas de creacion, en v2 se guardan en disco
 
     inode->i_op = &assoofs_inode_ops;  //se le asigna operaciones de inodo y de archivo 
     inode->i_fop = &assoofs_file_operations;
 
     inode_info = kzalloc(sizeof(struct assoofs_inode_info), GFP_KERNEL);   //se crea la estructura privadas de metadatos
+    if (!inode_info) {
+        iput(inode);
+        return -ENOMEM;
+    }
     inode_info->inode_no = inode->i_ino;  //numero de inodo
     inode_info->mode = S_IFREG | mode; //permisos
     inode_info->file_size = 0; //tamaño
-    inode_info->data_block_number = assoofs_sb_get_freeblock(sb);  //para el numero de bloque libre uso la funcion de abajo
+    inode_info->data_block_number = assoofs_sb_get_freeblock(sb, inode_no);  //para el numero de bloque libre uso la funcion de abajo
 
     inode->i_private = inode_info;  //guardamos todo en el inodo
 
-    // se le añade al directorio padre el que se nos paso 
-    bh = sb_bread(sb, parent_info->data_block_number);
-    record = (struct assoofs_dir_record_entry *)bh->b_data;
-    record += parent_info->dir_children_count;  //Nos desplazamos hasta la posición vacía (el siguiente slot libre en el array de entradas de directorio)
-
-    strcpy(record->filename, dentry->d_name.name); //rellenamos la nueva entrada
-    record->inode_no = inode_info->inode_no;
-    record->entry_removed = ASSOOFS_FALSE;
-
-    mark_buffer_dirty(bh);  //guardar cambios y liberar buffer
-    brelse(bh);
+    //primero el inodo: si falla el padre no se ha tocado y el hueco se reutiliza en el siguiente create
+    ret = assoofs_add_inode_info(sb, inode, inode_info); //guardamos nuevo inodo Funcion de abajo
+    if (ret) {
+        assoofs_drop_new_inode(inode);
+        return ret;
+    }
 
-    //se actualiza disco y estructuras
-    assoofs_add_inode_info(sb, inode_info); //guardamos nuevo inodo Funcion de abajo
+    // se le añade al directorio padre el que se nos paso (v1 o v2, ver assoofs_add_dir_record)
+    ret = assoofs_add_dir_record(sb, parent_info, dentry->d_name.name, inode_info->inode_no);
+    if (ret) {
+        assoofs_drop_new_inode(inode);
+        return ret;
+    }
 
     parent_info->dir_children_count++;  //actualizar conteos
+    inode_set_mtime_to_ts(dir, inode_set_ctime_current(dir));
+    ret = assoofs_add_inode_info(sb, dir, parent_info); //el padre tambien se guarda para no perder su nuevo numero de hijos
+    if (ret) { //la entrada escrita queda fuera de dir_children_count, asi que no se ve y la siguiente la pisa
+        parent_info->dir_children_count--;
+        assoofs_drop_new_inode(inode);
+        return ret;
+    }
     assoofs_sb->inodes_count++;
     assoofs_sb->free_inodes--;
+    assoofs_sb->free_blocks--; //cada inodo se lleva su bloque de datos
 
     assoofs_save_sb_info(sb);  // guardar superbloque actualizado en disco 
     struct buffer_head *new_bh = sb_getblk(sb, inode_info->data_block_number);
@@ -216,39 +303,242 @@ static int assoofs_create(struct mnt_idmap *idmap, struct inode *dir, struct den
     return 0;
 }
   
-static uint64_t assoofs_sb_get_freeinode(struct super_block *sb) {  //devuelve el siguiente numero de inodo disponible 
-    struct assoofs_super_block_info *assoofs_sb = sb->s_fs_info; //accede al superbloque extendido (con los scontadores)
-    uint64_t free_inode = ASSOOFS_LAST_RESERVED_INODE + 1 + assoofs_sb->inodes_count;  //el primero libre despues del ultimo reservado
-    return free_inode;
+//busca en el almacen de inodos el primer hueco libre despues de los reservados (raiz y README)
+//libre es links_count == 0 en v2 y mode == 0 en v1, unlink deja el hueco asi para que se reutilice
+static int assoofs_sb_get_freeinode(struct super_block *sb, uint64_t *inode_no) {
+    struct buffer_head *bh;
+    uint64_t i, slots = ASSOOFS_DEFAULT_BLOCK_SIZE / assoofs_inode_size(sb);
+    int ret = -ENOSPC;
+
+    bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+        return -EIO;
+
+    for (i = ASSOOFS_LAST_RESERVED_INODE + 2; i < slots; i++) { //0 es la raiz y 1 el README
+        bool is_free;
+
+        if (assoofs_is_v2(sb))
+            is_free = ((struct assoofs_inode_v2 *)bh->b_data)[i].links_count == 0;
+        else
+            is_free = ((struct assoofs_inode_info *)bh->b_data)[i].mode == 0;
+        if (is_free) {
+            *inode_no = i;
+            ret = 0;
+            break;
+        }
+    }
+    brelse(bh);
+    return ret;
 }
-static uint64_t assoofs_sb_get_freeblock(struct super_block *sb) {   //lo mismo pero para bloques
-    struct assoofs_super_block_info *assoofs_sb = sb->s_fs_info;
-    uint64_t free_block = ASSOOFS_LAST_RESERVED_BLOCK + 1 + assoofs_sb->inodes_count;
-    return free_block;
+static uint64_t assoofs_sb_get_freeblock(struct super_block *sb, uint64_t inode_no) {   //cada inodo tiene su bloque fijo, asi al reutilizar el inodo se reutiliza tambien el bloque
+    return ASSOOFS_LAST_RESERVED_BLOCK + inode_no; //README (inodo 1) esta en el bloque 3
 }
 static void assoofs_save_sb_info(struct super_block *sb) { //guarda los datos actualizados del superbloque en disco
     struct buffer_head *bh;  //obtenemos el superbloque extendido
     struct assoofs_super_block_info *assoofs_sb = sb->s_fs_info; //lo identificamos
 
     bh = sb_bread(sb, ASSOOFS_SUPERBLOCK_BLOCK_NUMBER); //leemos el bloque 0
-    memcpy(bh->b_data, assoofs_sb, sizeof(struct assoofs_super_block_info)); //copiamos la version actualizada en memoria
+    if (!bh)
+        return;
+    if (assoofs_is_v2(sb)) {  //en v2 se escribe en little-endian
+        struct assoofs_super_block_v2 *disk_sb = (struct assoofs_super_block_v2 *)bh->b_data;
+
+        disk_sb->version = cpu_to_le64(assoofs_sb->version);
+        disk_sb->magic = cpu_to_le64(assoofs_sb->magic);
+        disk_sb->block_size = cpu_to_le64(assoofs_sb->block_size);
+        disk_sb->inodes_count = cpu_to_le64(assoofs_sb->inodes_count);
+        disk_sb->free_blocks = cpu_to_le64(assoofs_sb->free_blocks);
+        disk_sb->free_inodes = cpu_to_le64(assoofs_sb->free_inodes);
+    } else {
+        memcpy(bh->b_data, assoofs_sb, sizeof(struct assoofs_super_block_info)); //copiamos la version actualizada en memoria
+    }
     mark_buffer_dirty(bh); //marcamos como modificado y se libera al bh
     sync_dirty_buffer(bh);
     brelse(bh);
 }
-static void assoofs_add_inode_info(struct super_block *sb, struct assoofs_inode_info *inode) { //añade un nuevo indo al almacen de inodos del disco
+//guarda un inodo en el almacen de inodos del disco, cada inodo va en la posicion de su numero (igual que lo lee assoofs_get_inode_info)
+static int assoofs_add_inode_info(struct super_block *sb, struct inode *inode, struct assoofs_inode_info *inode_info) {
     struct buffer_head *bh;
-    struct assoofs_inode_info *inode_info;
-    struct assoofs_super_block_info *assoofs_sb = sb->s_fs_info;
 
-    bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
-    inode_info = (struct assoofs_inode_info *)bh->b_data;
-    inode_info += assoofs_sb->inodes_count;  // siguiente inodo libre
+    if (inode_info->inode_no >= ASSOOFS_DEFAULT_BLOCK_SIZE / assoofs_inode_size(sb)) //no cabe en el bloque de inodos
+        return -ENOSPC;
 
-    memcpy(inode_info, inode, sizeof(struct assoofs_inode_info)); //copiar los nuevos datos del inodo al disco
+    bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+        return -EIO;
+
+    if (assoofs_is_v2(sb)) {  //v2: campos en little-endian, con los enlaces y las fechas del inodo VFS
+        struct assoofs_inode_v2 *disk = (struct assoofs_inode_v2 *)bh->b_data + inode_info->inode_no;
+
+        memset(disk, 0, sizeof(*disk));
+        disk->mode = cpu_to_le32(inode_info->mode);
+        disk->links_count = cpu_to_le32(inode->i_nlink);
+        disk->inode_no = cpu_to_le64(inode_info->inode_no);
+        disk->data_block_number = cpu_to_le64(inode_info->data_block_number);
+        disk->file_size = cpu_to_le64(inode_info->file_size); //union, vale tambien para dir_children_count
+        disk->atime = cpu_to_le64(inode_get_atime_sec(inode));
+        disk->mtime = cpu_to_le64(inode_get_mtime_sec(inode));
+        disk->ctime = cpu_to_le64(inode_get_ctime_sec(inode));
+    } else {
+        memcpy((struct assoofs_inode_info *)bh->b_data + inode_info->inode_no, inode_info, sizeof(struct assoofs_inode_info)); //copiar los nuevos datos del inodo al disco
+    }
     mark_buffer_dirty(bh);
     sync_dirty_buffer(bh);
     brelse(bh);
+    return 0;
+}
+//lee un inodo del almacen y devuelve una copia en memoria en el orden de la CPU, en v2 tambien rellena enlaces y fechas del inodo VFS
+static struct assoofs_inode_info *assoofs_get_inode_info(struct super_block *sb, struct inode *inode, uint64_t inode_no) {
+    struct buffer_head *bh;
+    struct assoofs_inode_info *inode_info;
+
+    if (inode_no >= ASSOOFS_DEFAULT_BLOCK_SIZE / assoofs_inode_size(sb))
+        return NULL;
+
+    bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+        return NULL;
+
+    inode_info = kzalloc(sizeof(struct assoofs_inode_info), GFP_KERNEL);
+    if (!inode_info) {
+        brelse(bh);
+        return NULL;
+    }
+
+    if (assoofs_is_v2(sb)) {
+        struct assoofs_inode_v2 *disk = (struct assoofs_inode_v2 *)bh->b_data + inode_no;
+
+        inode_info->mode = le32_to_cpu(disk->mode);
+        inode_info->inode_no = le64_to_cpu(disk->inode_no);
+        inode_info->data_block_number = le64_to_cpu(disk->data_block_number);
+        inode_info->file_size = le64_to_cpu(disk->file_size);
+        set_nlink(inode, le32_to_cpu(disk->links_count));
+        inode_set_atime(inode, le64_to_cpu(disk->atime), 0);
+        inode_set_mtime(inode, le64_to_cpu(disk->mtime), 0);
+        inode_set_ctime(inode, le64_to_cpu(disk->ctime), 0);
+    } else {
+        memcpy(inode_info, (struct assoofs_inode_info *)bh->b_data + inode_no, sizeof(struct assoofs_inode_info));
+    }
+    brelse(bh);
+    return inode_info;
+}
+//devuelve la entrada v2 que empieza en offset, o NULL si se sale del bloque o esta corrupta
+static struct assoofs_dir_record_v2 *assoofs_dir_record_v2_at(struct buffer_head *bh, size_t offset) {
+    struct assoofs_dir_record_v2 *record;
+    size_t rec_len;
+
+    if (offset + ASSOOFS_DIRENT_V2_HEADER_LEN > ASSOOFS_DEFAULT_BLOCK_SIZE)
+        return NULL;
+    record = (struct assoofs_dir_record_v2 *)(bh->b_data + offset);
+    rec_len = le16_to_cpu(record->rec_len);
+    if (rec_len < ASSOOFS_DIRENT_V2_REC_LEN(record->name_len) || offset + rec_len > ASSOOFS_DEFAULT_BLOCK_SIZE)
+        return NULL;
+    return record;
+}
+//añade la entrada nombre + inodo al final del bloque del directorio
+static int assoofs_add_dir_record(struct super_block *sb, struct assoofs_inode_info *dir_info, const char *name, uint64_t inode_no) {
+    struct buffer_head *bh;
+    size_t name_len = strlen(name);
+
+    if (name_len > ASSOOFS_FILENAME_MAXLEN)
+        return -ENAMETOOLONG;
+    if (!assoofs_is_v2(sb) && name_len >= ASSOOFS_FILENAME_MAXLEN) //en v1 filename[255] tambien guarda el '\0', el nombre cabe con 254 como mucho
+        return -ENAMETOOLONG;
+
+    bh = sb_bread(sb, dir_info->data_block_number);
+    if (!bh)
+        return -EIO;
+
+    if (assoofs_is_v2(sb)) {  //v2: se busca el final de la ultima entrada y se escribe solo lo que ocupa el nombre
+        struct assoofs_dir_record_v2 *record;
+        size_t offset = 0, rec_len = ASSOOFS_DIRENT_V2_REC_LEN(name_len);
+        int i;
+
+        for (i = 0; i < dir_info->dir_children_count; i++) {
+            record = assoofs_dir_record_v2_at(bh, offset);
+            if (!record) {
+                brelse(bh);
+                return -EIO;
+            }
+            offset += le16_to_cpu(record->rec_len);
+        }
+        if (offset + rec_len > ASSOOFS_DEFAULT_BLOCK_SIZE) {  //el bloque del directorio esta lleno
+            brelse(bh);
+            return -ENOSPC;
+        }
+
+        record = (struct assoofs_dir_record_v2 *)(bh->b_data + offset);
+        memset(record, 0, rec_len);
+        record->inode_no = cpu_to_le64(inode_no);
+        record->rec_len = cpu_to_le16(rec_len);
+        record->name_len = name_len;
+        memcpy(record->name, name, name_len);
+    } else {
+        struct assoofs_dir_record_entry *record = (struct assoofs_dir_record_entry *)bh->b_data;
+
+        if ((dir_info->dir_children_count + 1) * sizeof(*record) > ASSOOFS_DEFAULT_BLOCK_SIZE) {
+            brelse(bh);
+            return -ENOSPC;
+        }
+        record += dir_info->dir_children_count;  //Nos desplazamos hasta la posición vacía (el siguiente slot libre en el array de entradas de directorio)
+
+        strcpy(record->filename, name); //rellenamos la nueva entrada
+        record->inode_no = inode_no;
+        record->entry_removed = ASSOOFS_FALSE;
+    }
+
+    mark_buffer_dirty(bh);  //guardar cambios y liberar buffer
+    brelse(bh);
+    return 0;
+}
+//busca una entrada no borrada por nombre, devuelve su inodo en inode_no y si mark_removed la marca como borrada (soft delete)
+static int assoofs_find_dir_record(struct super_block *sb, struct assoofs_inode_info *dir_info, const char *name, uint64_t *inode_no, bool mark_removed) {
+    struct buffer_head *bh;
+    size_t name_len = strlen(name);
+    int i, ret = -ENOENT;
+
+    bh = sb_bread(sb, dir_info->data_block_number); //leer el bloque de directorio donde estan las entradas filename + inode num
+    if (!bh)
+        return -EIO;
+
+    if (assoofs_is_v2(sb)) {  //v2: se compara primero la longitud, asi casi nunca hace falta mirar el nombre
+        struct assoofs_dir_record_v2 *record;
+        size_t offset = 0;
+
+        for (i = 0; i < dir_info->dir_children_count; i++) {
+            record = assoofs_dir_record_v2_at(bh, offset);
+            if (!record)
+                break;
+            if (!(record->flags & ASSOOFS_DIRENT_V2_REMOVED) && record->name_len == name_len &&
+                memcmp(record->name, name, name_len) == 0) {
+                *inode_no = le64_to_cpu(record->inode_no);
+                if (mark_removed)
+                    record->flags |= ASSOOFS_DIRENT_V2_REMOVED;
+                ret = 0;
+                break;
+            }
+            offset += le16_to_cpu(record->rec_len);
+        }
+    } else {
+        struct assoofs_dir_record_entry *record = (struct assoofs_dir_record_entry *)bh->b_data;
+
+        for (i = 0; i < dir_info->dir_children_count; i++) { //recorremos las entradas del directorio
+            if (record->entry_removed == ASSOOFS_FALSE &&   //si el nombre coincide y no esta borrado es ese
+                strcmp(record->filename, name) == 0) {
+                *inode_no = record->inode_no;
+                if (mark_removed)
+                    record->entry_removed = ASSOOFS_TRUE; //aqui lo marcamos 
+                ret = 0;
+                break;
+            }
+            record++; //al siguiente
+        }
+    }
+
+    if (!ret && mark_removed)
+        mark_buffer_dirty(bh);
+    brelse(bh);
+    return ret;
 }
 //crear direetorio es muy parecido al create
 static int assoofs_mkdir(struct mnt_idmap *idmap, struct inode *dir, struct dentry *dentry, umode_t mode) {
@@ -257,8 +547,8 @@ static int assoofs_mkdir(struct mnt_idmap *idmap, struct inode *dir, struct dent
     struct assoofs_inode_info *parent_info = dir->i_private;
     struct inode *inode;
     struct assoofs_inode_info *inode_info;
-    struct buffer_head *bh;
-    struct assoofs_dir_record_entry *record;
+    uint64_t inode_no;
+    int ret;
 
     printk(KERN_INFO "assoofs_mkdir called\n");
 
@@ -267,39 +557,60 @@ static int assoofs_mkdir(struct mnt_idmap *idmap, struct inode *dir, struct dent
         return -ENOSPC;
     }
 
+    ret = assoofs_sb_get_freeinode(sb, &inode_no);
+    if (ret)
+        return ret;
+
     inode = new_inode(sb);      //crear nuevo inodo 
-    inode->i_ino = assoofs_sb_get_freeinode(sb);
+    if (!inode)
+        return -ENOMEM;
+    inode->i_ino = inode_no;
     inode->i_sb = sb;
     inode_init_owner(&nop_mnt_idmap, inode, dir, S_IFDIR | mode);
+    simple_inode_init_ts(inode);
+    inc_nlink(inode); //un directorio nace con 2 enlaces: "." y su entrada en el padre
 
     inode->i_op = &assoofs_inode_ops;
     inode->i_fop = &assoofs_dir_operations; //operaciones de directorio 
 
     inode_info = kzalloc(sizeof(struct assoofs_inode_info), GFP_KERNEL);
+    if (!inode_info) {
+        iput(inode);
+        return -ENOMEM;
+    }
     inode_info->inode_no = inode->i_ino;
     inode_info->mode = S_IFDIR | mode;  //directorio 
     inode_info->file_size = 0;
-    inode_info->data_block_number = assoofs_sb_get_freeblock(sb);
+    inode_info->data_block_number = assoofs_sb_get_freeblock(sb, inode_no);
 
     inode->i_private = inode_info;
 
     // Cualquier duda revisar create que es mas o menos lo mismo 
-    bh = sb_bread(sb, parent_info->data_block_number);
-    record = (struct assoofs_dir_record_entry *)bh->b_data;
-    record += parent_info->dir_children_count;
-
-    strcpy(record->filename, dentry->d_name.name);
-    record->inode_no = inode_info->inode_no;
-    record->entry_removed = ASSOOFS_FALSE;
+    ret = assoofs_add_inode_info(sb, inode, inode_info);
+    if (ret) {
+        assoofs_drop_new_inode(inode);
+        return ret;
+    }
 
-    mark_buffer_dirty(bh);
-    brelse(bh);
-    
-    assoofs_add_inode_info(sb, inode_info);
+    ret = assoofs_add_dir_record(sb, parent_info, dentry->d_name.name, inode_info->inode_no);
+    if (ret) {
+        assoofs_drop_new_inode(inode);
+        return ret;
+    }
 
     parent_info->dir_children_count++;
+    inc_nlink(dir); //el ".." del hijo apunta al padre
+    inode_set_mtime_to_ts(dir, inode_set_ctime_current(dir));
+    ret = assoofs_add_inode_info(sb, dir, parent_info);
+    if (ret) {
+        parent_info->dir_children_count--;
+        drop_nlink(dir);
+        assoofs_drop_new_inode(inode);
+        return ret;
+    }
     assoofs_sb->inodes_count++;
     assoofs_sb->free_inodes--;
+    assoofs_sb->free_blocks--; //cada inodo se lleva su bloque de datos
 
     assoofs_save_sb_info(sb);  
     struct buffer_head *new_bh = sb_getblk(sb, inode_info->data_block_number);
@@ -317,54 +628,36 @@ static int assoofs_mkdir(struct mnt_idmap *idmap, struct inode *dir, struct dent
 struct dentry *assoofs_lookup(struct inode *parent_inode, struct dentry *child_dentry, unsigned int flags) {
     struct super_block *sb = parent_inode->i_sb; //obtenemos el superbloque y metadatos del directorio padre
     struct assoofs_inode_info *parent_info = parent_inode->i_private; 
-    struct buffer_head *bh;
-    struct assoofs_dir_record_entry *record;
-    int i;
+    struct assoofs_inode_info *inode_info;
+    struct inode *inode;
+    uint64_t inode_no;
 
     printk(KERN_INFO "assoofs_lookup called for name: %s\n", child_dentry->d_name.name);
 
-    bh = sb_bread(sb, parent_info->data_block_number); //leer el bloque de directorio donde estan las entradas filename + inode num
-    record = (struct assoofs_dir_record_entry *)bh->b_data;
-
-    for (i = 0; i < parent_info->dir_children_count; i++) { //recorremos las entradas del directorio
-        if (record->entry_removed == ASSOOFS_FALSE &&   //si el nombre coincide y no esta borrado es ese
-            strcmp(record->filename, child_dentry->d_name.name) == 0) {
-                                //cargar su inodo
-            struct inode *inode;  
-            struct buffer_head *inode_bh;
-            struct assoofs_inode_info *inode_info;
-
-            // Leer el inodo correspondiente
-            inode = new_inode(sb);  //creamos un nuevo inodo vacio con el numero correcto
-            inode->i_ino = record->inode_no;
-            inode->i_sb = sb;
+    if (assoofs_find_dir_record(sb, parent_info, child_dentry->d_name.name, &inode_no, false)) //si no esta (o esta borrado) no hay nada que añadir
+        return NULL;
 
-            inode_bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);  //leemos los inodos almacenados en el bloque
-            inode_info = (struct assoofs_inode_info *)inode_bh->b_data;
-
-            // Saltar hasta el inodo correcto
-            inode_info += record->inode_no;  //satamos hasta ek que buscamos
-
-            inode_init_owner(&nop_mnt_idmap, inode, parent_inode, inode_info->mode);  //configurar el propietario 
-            inode->i_op = &assoofs_inode_ops;  //operaciones
-            if (S_ISDIR(inode_info->mode))  //si es archivo o directorio 
-                inode->i_fop = &assoofs_dir_operations;
-            else
-                inode->i_fop = &assoofs_file_operations;
+    // Leer el inodo correspondiente
+    inode = new_inode(sb);  //creamos un nuevo inodo vacio con el numero correcto
+    inode->i_ino = inode_no;
+    inode->i_sb = sb;
 
-            inode->i_private = kzalloc(sizeof(struct assoofs_inode_info), GFP_KERNEL);  //guardamos sus metadatos
-            memcpy(inode->i_private, inode_info, sizeof(struct assoofs_inode_info));
+    inode_info = assoofs_get_inode_info(sb, inode, inode_no); //leemos sus metadatos del almacen de inodos
+    if (!inode_info) {
+        iput(inode);
+        return ERR_PTR(-EIO);
+    }
 
-            brelse(inode_bh); //liberar bloques y demas
-            brelse(bh);
+    inode_init_owner(&nop_mnt_idmap, inode, parent_inode, inode_info->mode);  //configurar el propietario 
+    inode->i_op = &assoofs_inode_ops;  //operaciones
+    if (S_ISDIR(inode_info->mode))  //si es archivo o directorio 
+        inode->i_fop = &assoofs_dir_operations;
+    else
+        inode->i_fop = &assoofs_file_operations;
 
-            d_add(child_dentry, inode);  //asociamos el inodo al dentry
-            return NULL;
-        }
-        record++; //al siguiente
-    }
+    inode->i_private = inode_info;  //guardamos sus metadatos
 
-    brelse(bh);
+    d_add(child_dentry, inode);  //asociamos el inodo al dentry
     return NULL;
 }
 //lee los datos de un archivo (cat)
@@ -424,9 +717,10 @@ static ssize_t assoofs_write(struct file *filp, const char __user *buf, size_t l
     *ppos += len; //actualizamos posicion y tamaño del archivo
     inode_info->file_size = *ppos;
     inode->i_size = inode_info->file_size;
+    inode_set_mtime_to_ts(inode, inode_set_ctime_current(inode));
 
     mark_inode_dirty(inode);  //marcamos el inodo como sucio hay que guardar su nueva info 
-    assoofs_add_inode_info(sb, inode_info);
+    assoofs_add_inode_info(sb, inode, inode_info);
 
     ret = len;
     return ret;
@@ -437,28 +731,23 @@ static int assoofs_remove(struct inode *dir, struct dentry *dentry) {
     struct super_block *sb = dir->i_sb; //ahora mediante el dir buscamos cual es el superbloque del sistema
     struct assoofs_super_block_info *assoofs_sb = sb->s_fs_info; // en sb estamos apuntando al superbloque aqui apuntamos a 
     struct assoofs_inode_info *parent_info = dir->i_private;
-    struct buffer_head *bh;
-    struct assoofs_dir_record_entry *record;
-    int i;
+    uint64_t inode_no;
+    int ret;
 
     printk(KERN_INFO "assoofs_remove called for %s\n", dentry->d_name.name);
 
-    // 1. Marcar la entrada como eliminada en el directorio
-    bh = sb_bread(sb, parent_info->data_block_number);  //leemos bloque donde estan las entradas del diretorio
-    record = (struct assoofs_dir_record_entry *)bh->b_data;
+    // 1. Guardar el padre y despues marcar la entrada como eliminada, si falla lo primero no se ha borrado nada
+    inode_set_mtime_to_ts(dir, inode_set_ctime_current(dir));
+    ret = assoofs_add_inode_info(sb, dir, parent_info);
+    if (ret)
+        return ret;
 
-    for (i = 0; i < parent_info->dir_children_count; i++) {  //buscamos la entrada por nombre y marcamos como eliminada
-        if (strcmp(record->filename, dentry->d_name.name) == 0) {
-            record->entry_removed = ASSOOFS_TRUE; //aqui lo marcamos 
-            mark_buffer_dirty(bh);
-            break;
-        }
-        record++;
-    }
-    brelse(bh);
+    if (assoofs_find_dir_record(sb, parent_info, dentry->d_name.name, &inode_no, true))
+        return -ENOENT;
 
-    // 2. Decrementar contadores
-    parent_info->dir_children_count--;
+    // 2. Actualizar contadores
+    // dir_children_count no se toca: cuenta las entradas escritas en el bloque (tambien las borradas),
+    // si bajara, la siguiente entrada nueva pisaria a la ultima
     assoofs_sb->inodes_count--;
     assoofs_sb->free_inodes++;
     assoofs_sb->free_blocks++;
@@ -468,7 +757,13 @@ static int assoofs_remove(struct inode *dir, struct dentry *dentry) {
     // 3. Borrar el inodo (liberarlo)
     clear_nlink(inode);   //Eliminamos todos los enlaces duros del inodo (clear_nlink), ponemos ->
     inode->i_size = 0;     //-> tamaño a 0 y marcamos el inodo como modificado para que se actualice.
+    inode_set_ctime_current(inode);
     mark_inode_dirty(inode);
+    if (!assoofs_is_v2(sb)) //v1 no tiene links_count, el hueco libre se marca con mode == 0
+        ((struct assoofs_inode_info *)inode->i_private)->mode = 0;
+    //el hueco queda libre para assoofs_sb_get_freeinode (links_count 0 en v2), la entrada ya esta borrada asi que solo se avisa
+    if (assoofs_add_inode_info(sb, inode, inode->i_private))
+        printk(KERN_ERR "Could not free inode %lu on disk\n", inode->i_ino);
 
     printk(KERN_INFO "File %s removed successfully\n", dentry->d_name.name);
     return 0;
@@ -2,9 +2,13 @@
 #define ASSOOFS_H
 
 #include <linux/stat.h>
+#include <linux/types.h>
 
 
 #define ASSOOFS_MAGIC 0x20200406   //NUMERO MAGICO asi el kernel sabra que es ASSOOFS
+#define ASSOOFS_VERSION_V1 1 //formato original: structs en orden de la CPU y nombres fijos de 255 bytes
+#define ASSOOFS_VERSION_V2 2 //formato nuevo: little-endian, inodos de 64 bytes y entradas de longitud variable
+#define ASSOOFS_VERSION ASSOOFS_VERSION_V2 //version que escribe mkassoofs por defecto
 #define ASSOOFS_DEFAULT_BLOCK_SIZE 4096 //Tamaño del bloque en bytes
 #define ASSOOFS_FILENAME_MAXLEN 255  //tamaño maximo de nombres de archivo (255 char)
 
@@ -13,7 +17,7 @@
 #define ASSOOFS_ROOTDIR_BLOCK_NUMBER 2
 #define ASSOOFS_ROOTDIR_INODE_NUMBER 0
 
-#define ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED 64  El sistema solo soportara hasta 64 archivos/objetos/ficheros/cartoonNetwork
+#define ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED 64  //El sistema solo soportara hasta 64 archivos/objetos/ficheros/cartoonNetwork
 
 #define ASSOOFS_LAST_RESERVED_BLOCK ASSOOFS_ROOTDIR_BLOCK_NUMBER     //asi sabremos donde empezar despues del reformateo justo despues de todo el espacio reservado
 #define ASSOOFS_LAST_RESERVED_INODE ASSOOFS_ROOTDIR_INODE_NUMBER
@@ -47,6 +51,56 @@ struct assoofs_inode_info {   //info que tendra el inodo
 	};
 };
 
+// ---- Formato v2 ----
+// Todo en little-endian y con tamaños fijos para que la imagen sea la misma en cualquier maquina.
+
+struct assoofs_super_block_v2 { //mismos campos y bloque que assoofs_super_block_info pero en little-endian
+	__le64 version;
+	__le64 magic;
+	__le64 block_size;
+	__le64 inodes_count;
+	__le64 free_blocks; //contadores reales: un bloque de datos por inodo
+	__le64 free_inodes;
+	char padding[4048];
+};
+
+#define ASSOOFS_INODE_V2_SIZE 64 //un inodo ocupa exactamente una linea de cache, caben 64 en el bloque de inodos
+#define ASSOOFS_INODE_V2_SLOTS (ASSOOFS_DEFAULT_BLOCK_SIZE / ASSOOFS_INODE_V2_SIZE)
+#define ASSOOFS_DIRENT_V2_ALIGN 8 //las entradas se alinean a 8 para que inode_no nunca quede desalineado
+#define ASSOOFS_DIRENT_V2_REMOVED 0x01 //flag de borrado (soft delete como en v1)
+
+struct assoofs_inode_v2 {
+	__le32 mode; //tipo y permisos, 32 bits fijos en vez de mode_t
+	__le32 links_count; //numero de enlaces duros, 0 = hueco libre
+	__le64 inode_no;
+	__le64 data_block_number;
+	union {
+		__le64 file_size;
+		__le64 dir_children_count; //entradas escritas en el bloque del directorio (incluidas las borradas)
+	};
+	__le64 atime; //segundos desde epoch
+	__le64 mtime;
+	__le64 ctime;
+	__le32 flags;
+	__le32 reserved; //relleno hasta los 64 bytes, debe ser 0
+} __attribute__((packed, aligned(ASSOOFS_INODE_V2_SIZE)));
+
+struct assoofs_dir_record_v2 { //cabecera de 12 bytes seguida del nombre sin '\0'
+	__le64 inode_no;
+	__le16 rec_len; //longitud total de la entrada (cabecera + nombre + relleno), multiplo de 8
+	__u8 name_len;
+	__u8 flags;
+	char name[];
+} __attribute__((packed));
+
+#define ASSOOFS_DIRENT_V2_HEADER_LEN 12
+#define ASSOOFS_DIRENT_V2_REC_LEN(name_len) \
+	(((ASSOOFS_DIRENT_V2_HEADER_LEN + (name_len)) + ASSOOFS_DIRENT_V2_ALIGN - 1) & ~(ASSOOFS_DIRENT_V2_ALIGN - 1))
+
+_Static_assert(sizeof(struct assoofs_super_block_v2) == ASSOOFS_DEFAULT_BLOCK_SIZE, "assoofs_super_block_v2 must fill one block");
+_Static_assert(sizeof(struct assoofs_inode_v2) == ASSOOFS_INODE_V2_SIZE, "assoofs_inode_v2 must be 64 bytes");
+_Static_assert(sizeof(struct assoofs_dir_record_v2) == ASSOOFS_DIRENT_V2_HEADER_LEN, "assoofs_dir_record_v2 header must be 12 bytes");
+
 #endif
 
 
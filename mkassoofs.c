@@ -7,21 +7,34 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <endian.h>
+#include <time.h>
 #include "assoofs.h"
 //estamos reservando para el sistema bloques para el directorio raiz y para un archivo ejemplo que sera el readme
 #define WELCOMEFILE_DATABLOCK_NUMBER (ASSOOFS_LAST_RESERVED_BLOCK + 1)        //bloque de datos donde se almacena el contenido de README.txt
 #define WELCOMEFILE_INODE_NUMBER (ASSOOFS_LAST_RESERVED_INODE + 1)            //Numero de inodo que lo identificara
 
-static int write_superblock(int fd) {      //escribe un superbloque con la informacion esencial del sistema
+static int write_superblock(int fd, int version) {      //escribe un superbloque con la informacion esencial del sistema
 	struct assoofs_super_block_info sb = {
-    	.version = 1,
+    	.version = version,
     	.magic = ASSOOFS_MAGIC, //permite que el kernel reconozca que es un sistema ASSOOFS es algo asi como una firma
     	.block_size = ASSOOFS_DEFAULT_BLOCK_SIZE,   //tamaño de cada bloque
     	.inodes_count = 2, // root dir + README.txt   esos son los inodos que tendra ya de por si
     	.free_blocks = (15), // 1111    son bloques que estan libres por si los quiere usar
     	.free_inodes = (3), // 11    lo mismo
 	};
-	ssize_t ret = write(fd, &sb, sizeof(sb));
+	struct assoofs_super_block_v2 sb_v2 = {   //en v2 el superbloque va siempre en little-endian
+    	.version = htole64(version),
+    	.magic = htole64(ASSOOFS_MAGIC),
+    	.block_size = htole64(ASSOOFS_DEFAULT_BLOCK_SIZE),
+    	.inodes_count = htole64(sb.inodes_count),
+    	.free_blocks = htole64(ASSOOFS_INODE_V2_SLOTS - sb.inodes_count), //contadores reales: huecos libres del almacen de inodos, cada uno con su bloque
+    	.free_inodes = htole64(ASSOOFS_INODE_V2_SLOTS - sb.inodes_count),
+	};
+	const void *buf = &sb;
+	if (version == ASSOOFS_VERSION_V2)
+    	buf = &sb_v2;
+	ssize_t ret = write(fd, buf, ASSOOFS_DEFAULT_BLOCK_SIZE);
 	if (ret != ASSOOFS_DEFAULT_BLOCK_SIZE) {   //comprueba el tamaño
     	printf("Bytes written [%d] are not equal to the default block size.\n", (int)ret);
     	return -1;
@@ -30,15 +43,42 @@ static int write_superblock(int fd) {      //escribe un superbloque con la infor
 	return 0;
 }
 
-static int write_root_inode(int fd) {   //crea el inodo directorio raiz
+static void inode_to_v2(const struct assoofs_inode_info *i, struct assoofs_inode_v2 *disk) {  //pasa un inodo al formato v2 (little-endian, 64 bytes)
+	uint64_t now = (uint64_t)time(NULL);
+
+	memset(disk, 0, sizeof(*disk));
+	disk->mode = htole32(i->mode);
+	disk->links_count = htole32(S_ISDIR(i->mode) ? 2 : 1);  //un directorio tiene "." y la entrada en su padre
+	disk->inode_no = htole64(i->inode_no);
+	disk->data_block_number = htole64(i->data_block_number);
+	disk->file_size = htole64(i->file_size);  //es una union asi que vale tambien para dir_children_count
+	disk->atime = disk->mtime = disk->ctime = htole64(now);
+}
+
+static int write_inode(int fd, const struct assoofs_inode_info *i, int version) {  //escribe un inodo en el formato que toque
+	struct assoofs_inode_v2 disk;
+	const void *buf = i;
+	size_t len = sizeof(*i);
+
+	if (version == ASSOOFS_VERSION_V2) {
+    	inode_to_v2(i, &disk);
+    	buf = &disk;
+    	len = sizeof(disk);
+	}
+	ssize_t ret = write(fd, buf, len);
+	if (ret != len)
+    	return -1;
+	return 0;
+}
+
+static int write_root_inode(int fd, int version) {   //crea el inodo directorio raiz
 	struct assoofs_inode_info root_inode = {
     	.mode = S_IFDIR,  //le indica al kernel que es un directorio no un archivo
     	.inode_no = ASSOOFS_ROOTDIR_INODE_NUMBER,   //Es el numero de indo que siempre es 0 algo asi como la red que siempre es0 su ip
     	.data_block_number = ASSOOFS_ROOTDIR_BLOCK_NUMBER,  //bloque asociado apuanta al bloque con las entras del directorio 
     	.dir_children_count = 1,    //numero de entradas, para este caso solo es 1, el Readme.txt
 	};
-	ssize_t ret = write(fd, &root_inode, sizeof(root_inode));     //comprobamos tamaño para ver que se ha escrito bien
-	if (ret != sizeof(root_inode)) {
+	if (write_inode(fd, &root_inode, version)) {     //comprobamos tamaño para ver que se ha escrito bien
     	printf("The inode store was not written properly.\n");
     	return -1;
 	}
@@ -46,17 +86,18 @@ static int write_root_inode(int fd) {   //crea el inodo directorio raiz
 	return 0;
 }
 
-static int write_welcome_inode(int fd, const struct assoofs_inode_info *i) {  //este es el inodo del README se le pasa el descriptor y el readme
-	ssize_t ret = write(fd, i, sizeof(*i));    //Su tamaño lo calculamos con lo que devuelva write
-	if (ret != sizeof(*i)) {
+static int write_welcome_inode(int fd, const struct assoofs_inode_info *i, int version) {  //este es el inodo del README se le pasa el descriptor y el readme
+	if (write_inode(fd, i, version)) {
     	printf("The welcomefile inode was not written properly.\n");
     	return -1;
 	}
 	printf("Welcomefile inode written successfully.\n");
 
-	off_t nbytes = ASSOOFS_DEFAULT_BLOCK_SIZE - (sizeof(*i) * 2);
-	ret = lseek(fd, nbytes, SEEK_CUR);   //salto para alinear con los siguiente bloque tras los dos inodos
-	if (ret == (off_t)-1) {
+	size_t inode_size = version == ASSOOFS_VERSION_V2 ? sizeof(struct assoofs_inode_v2) : sizeof(*i);
+	static const char zeros[ASSOOFS_DEFAULT_BLOCK_SIZE];
+	ssize_t nbytes = ASSOOFS_DEFAULT_BLOCK_SIZE - (inode_size * 2);
+	ssize_t ret = write(fd, zeros, nbytes);   //se rellena con ceros: el modulo toma los huecos a cero como inodos libres
+	if (ret != nbytes) {
     	printf("The padding bytes are not written properly.\n");
     	return -1;
 	}
@@ -64,16 +105,32 @@ static int write_welcome_inode(int fd, const struct assoofs_inode_info *i) {  //
 	return 0;
 }
 
-static int write_dirent(int fd, const struct assoofs_dir_record_entry *record) { //entrada del directorio de archivo de README dento del directorio raiz
+static int write_dirent(int fd, const struct assoofs_dir_record_entry *record, int version) { //entrada del directorio de archivo de README dento del directorio raiz
+	char buf[ASSOOFS_DIRENT_V2_REC_LEN(ASSOOFS_FILENAME_MAXLEN)];
+	const void *data = record;
 	ssize_t nbytes = sizeof(*record), ret;
-	ret = write(fd, record, nbytes);
+
+	if (version == ASSOOFS_VERSION_V2) {  //en v2 solo se escribe la cabecera y el nombre justo, redondeado a 8
+    	struct assoofs_dir_record_v2 *disk = (struct assoofs_dir_record_v2 *)buf;
+    	size_t name_len = strlen(record->filename);
+
+    	nbytes = ASSOOFS_DIRENT_V2_REC_LEN(name_len);
+    	memset(buf, 0, nbytes);
+    	disk->inode_no = htole64(record->inode_no);
+    	disk->rec_len = htole16(nbytes);
+    	disk->name_len = name_len;
+    	disk->flags = record->entry_removed ? ASSOOFS_DIRENT_V2_REMOVED : 0;
+    	memcpy(disk->name, record->filename, name_len);
+    	data = buf;
+	}
+	ret = write(fd, data, nbytes);
 	if (ret != nbytes) {
     	printf("Writing the rootdirectory datablock (name+inode_no pair) has failed.\n");
     	return -1;
 	}
 	printf("Root directory datablocks written successfully.\n");
 
-	nbytes = ASSOOFS_DEFAULT_BLOCK_SIZE - sizeof(*record);
+	nbytes = ASSOOFS_DEFAULT_BLOCK_SIZE - nbytes;
 	ret = lseek(fd, nbytes, SEEK_CUR);
 	if (ret == (off_t)-1) {
     	printf("Writing the padding for rootdirectory children datablock has failed.\n");
@@ -94,8 +151,14 @@ static int write_block(int fd, char *block, size_t len) {
 }
 
 int main(int argc, char *argv[]) {
+	int version = ASSOOFS_VERSION;
+	if (argc == 3 && strcmp(argv[1], "-1") == 0) {   //-1 para generar imagenes con el formato antiguo
+    	version = ASSOOFS_VERSION_V1;
+    	argv++;
+    	argc--;
+	}
 	if (argc != 2) {   //comprovamos que se nos pase el segundo argumento que es la imagen .img
-    	printf("Usage: mkassoofs <device>\n");
+    	printf("Usage: mkassoofs [-1] <device>\n");
     	return -1;
 	}
 
@@ -105,7 +168,7 @@ int main(int argc, char *argv[]) {
     	return -1;
 	}
 
-	char welcomefile_body[] = "Autor: Juan Alberto Pablos Yugueros\nDNI: 71716147P"\nObservaciones: el sistema falla al crear directorios, no he podido arreglarlo ya que cuando lo solucionaba fallaba al crear el README.txt.;   //esto es la declaracion de lo que escribiremos en el Readme
+	char welcomefile_body[] = "Autor: Juan Alberto Pablos Yugueros\nDNI: 71716147P\nObservaciones: el sistema falla al crear directorios, no he podido arreglarlo ya que cuando lo solucionaba fallaba al crear el README.txt.";   //esto es la declaracion de lo que escribiremos en el Readme
 
 	struct assoofs_inode_info welcome = {   //EStructura del inodo del README
     	.mode = S_IFREG, //Se le indica que es un archivo no un directorio 
@@ -122,10 +185,10 @@ int main(int argc, char *argv[]) {
 
 	int ret = 1;
 	do { //bucle para realizar cada operacion y asi tener el formateo
-    	if (write_superblock(fd)) break;
-    	if (write_root_inode(fd)) break;
-    	if (write_welcome_inode(fd, &welcome)) break;
-    	if (write_dirent(fd, &record)) break;
+    	if (write_superblock(fd, version)) break;
+    	if (write_root_inode(fd, version)) break;
+    	if (write_welcome_inode(fd, &welcome, version)) break;
+    	if (write_dirent(fd, &record, version)) break;
     	if (write_block(fd, welcomefile_body, welcome.file_size)) break;
     	ret = 0;
 	} while (0);